@@ -0,0 +1,698 @@
+#include <opencv2/core.hpp>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include "pipeline.h"
+#include "streaming.h"
+#include "raw_frames.h"
+
+// Accuracy and throughput regression harness working on synthetic scenes with known ground truth
+//
+// Usage: prymat_benchmark [--baseline path] [--update-baseline [--record-throughput]] [--accuracy-tolerance t]
+//                         [--relative-throughput-tolerance t] [--throughput-tolerance t]
+// Fails when precision or recall drop by more than the accuracy tolerance, or throughput drops by more than
+// its tolerance (fraction of the baseline) at any resolution, for any pipeline configuration
+// Throughput is always checked relative to a fixed reference kernel timed on the same scenes, which keeps the
+// committed baseline usable across similar machines, its tolerance is coarse since the ratio still moves with load.
+// Absolute frames per second are only recorded and checked on request, for baselines kept on a single machine
+// A missing baseline is an error, --update-baseline writes a new one instead of checking
+
+// Every other scene has brightness contrast and is also run through the grayscale front end,
+// every other one of those is lit unevenly
+const int SCENES_PER_RESOLUTION = 8;
+const int GRAYSCALE_SCENES = SCENES_PER_RESOLUTION / 2;
+const unsigned SCENE_SEED = 1234;
+// Runs of each scene and configuration whose fastest one counts towards relative throughput
+const int TIMING_REPEATS = 5;
+// The reference kernel is much quicker than the pipeline, passes per run bring both to a similar length so
+// interruptions of the machine hit them alike
+const int REFERENCE_PASSES = 8;
+const std::vector<cv::Size> RESOLUTIONS = {cv::Size(1280, 720), cv::Size(1920, 1080), cv::Size(2560, 1440)};
+
+//! SYNTHETIC SCENES
+
+struct SyntheticScene
+{
+    cv::Mat image;
+    // Boxes of objects the pipeline should confirm, in image coordinates
+    std::vector<cv::Vec4i> ground_truth;
+    // Objects are also brighter than the background and their frames, so the grayscale front end can see them
+    bool brightness_contrast = false;
+    // Brightness falls off across the scene, a single global threshold can't separate objects from background
+    bool illumination_gradient = false;
+};
+
+// Converts HSV (hue 0 - 179, saturation and value 0 - 255) to BGR
+cv::Vec3b convertHSVToBGR(double hue, double saturation, double value)
+{
+    double h = hue * 2.0 / 60.0;
+    double s = saturation / 255.0;
+    double v = value / 255.0;
+
+    double c = v * s;
+    double x = c * (1 - std::abs(std::fmod(h, 2.0) - 1));
+    double m = v - c;
+
+    double r = 0, g = 0, b = 0;
+    if (h < 1) { r = c; g = x; }
+    else if (h < 2) { r = x; g = c; }
+    else if (h < 3) { g = c; b = x; }
+    else if (h < 4) { g = x; b = c; }
+    else if (h < 5) { r = x; b = c; }
+    else { r = c; b = x; }
+
+    return cv::Vec3b(correctColorRange((b + m) * 255), correctColorRange((g + m) * 255), correctColorRange((r + m) * 255));
+}
+
+// Value ranges of the brightness contrast scenes, lumas of bright objects and dark surroundings stay apart
+const double BRIGHT_MIN_VALUE = 200;
+const double DARK_MAX_VALUE = 90;
+// Blue hues have a low luma even at full value, bright objects keep below them
+const double BRIGHT_MAX_HUE = 100;
+// Share of the full brightness left at the darkest side of an unevenly lit scene
+const double GRADIENT_MIN_LIGHT = 0.4;
+// Surroundings of unevenly lit scenes are brighter, so lit background outshines objects in the shade
+const double GRADIENT_BACKGROUND_MIN_VALUE = 120;
+const double GRADIENT_BACKGROUND_MAX_VALUE = 170;
+
+// Fills a rectangle with the given hue, saturation and value are jittered per pixel
+void fillNoisyRect(cv::Mat& image, cv::Rect rect, double hue, std::mt19937& rng, double min_value = 140, double max_value = 255)
+{
+    std::uniform_real_distribution<double> saturation(170, 255);
+    std::uniform_real_distribution<double> value(min_value, max_value);
+
+    for (int y = rect.y; y < rect.y + rect.height; y++)
+    {
+        for (int x = rect.x; x < rect.x + rect.width; x++)
+        {
+            image.at<cv::Vec3b>(y, x) = convertHSVToBGR(hue, saturation(rng), value(rng));
+        }
+    }
+}
+
+// Darkens the image linearly along a random direction, scaling all channels keeps hue and saturation
+void applyIlluminationGradient(cv::Mat& image, std::mt19937& rng)
+{
+    std::uniform_real_distribution<double> direction(0, 2 * CV_PI);
+    double angle = direction(rng);
+    double dx = std::cos(angle);
+    double dy = std::sin(angle);
+
+    // Projections of the corners give the range the light is spread over
+    double low = std::min(0.0, dx * (image.cols - 1)) + std::min(0.0, dy * (image.rows - 1));
+    double high = std::max(0.0, dx * (image.cols - 1)) + std::max(0.0, dy * (image.rows - 1));
+
+    for (int y = 0; y < image.rows; y++)
+    {
+        cv::Vec3b* row = image.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < image.cols; x++)
+        {
+            double light = GRADIENT_MIN_LIGHT + (1 - GRADIENT_MIN_LIGHT) * (dx * x + dy * y - low) / (high - low);
+            for (int c = 0; c < 3; c++) row[x][c] = correctColorRange(static_cast<float>(row[x][c] * light + 0.5));
+        }
+    }
+}
+
+// Generates a scene with objects in the accepted hue range on a background outside of it
+// Targets carry a square black frame whose shape and area ratio pass analyseROIs, decoys are plain or filled
+// Without brightness contrast objects and background share the value range and differ in hue only,
+// an illumination gradient darkens part of a contrast scene below the lit background
+SyntheticScene generateScene(cv::Size size, const DetectionParams& params, bool brightness_contrast, bool illumination_gradient, std::mt19937& rng)
+{
+    SyntheticScene scene;
+    scene.image = cv::Mat(size, CV_8UC3);
+    scene.brightness_contrast = brightness_contrast;
+    scene.illumination_gradient = illumination_gradient;
+
+    double low_hue = params.lower_margin[0];
+    double high_hue = params.upper_margin[0];
+    std::uniform_real_distribution<double> background_hue(0, low_hue - 5);
+    std::uniform_real_distribution<double> object_hue(low_hue + 10, brightness_contrast ? BRIGHT_MAX_HUE : high_hue - 10);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    double object_min_value = brightness_contrast ? BRIGHT_MIN_VALUE : 140;
+    double background_min_value = 140;
+    double background_max_value = 255;
+    if (illumination_gradient)
+    {
+        background_min_value = GRADIENT_BACKGROUND_MIN_VALUE;
+        background_max_value = GRADIENT_BACKGROUND_MAX_VALUE;
+    }
+    else if (brightness_contrast)
+    {
+        background_min_value = 30;
+        background_max_value = DARK_MAX_VALUE;
+    }
+    auto fillObject = [&](cv::Rect rect) { fillNoisyRect(scene.image, rect, object_hue(rng), rng, object_min_value, 255); };
+    auto fillBackground = [&](cv::Rect rect) { fillNoisyRect(scene.image, rect, background_hue(rng), rng, background_min_value, background_max_value); };
+
+    fillBackground(cv::Rect(0, 0, size.width, size.height));
+
+    // Objects must pass findROIs size limits after scaling, one object per quadrant keeps them apart
+    double scale_factor = params.scale / 100.0;
+    int min_width = static_cast<int>((params.min_width + 10) / scale_factor);
+    int min_height = static_cast<int>((params.min_height + 10) / scale_factor);
+    int max_width = static_cast<int>(size.width * 0.45);
+    int max_height = static_cast<int>(size.height * 0.45);
+    CV_Assert(min_width < max_width && min_height < max_height);
+
+    for (int quadrant = 0; quadrant < 4; quadrant++)
+    {
+        double kind = unit(rng);
+        if (kind < 0.2) continue;
+
+        int height = min_height + static_cast<int>(unit(rng) * (max_height - min_height));
+        int width = std::max(min_width, height) + static_cast<int>(unit(rng) * (max_width - std::max(min_width, height)));
+        width = std::min({width, max_width, height * 8 / 5});
+
+        int cell_x = (quadrant % 2) * size.width / 2;
+        int cell_y = (quadrant / 2) * size.height / 2;
+        int x = cell_x + 8 + static_cast<int>(unit(rng) * (size.width / 2 - width - 16));
+        int y = cell_y + 8 + static_cast<int>(unit(rng) * (size.height / 2 - height - 16));
+
+        fillObject(cv::Rect(x, y, width, height));
+
+        // Frame side chosen so black area is about a fifth of the object, inner side ratio keeps M7 in range
+        int outer = static_cast<int>(std::sqrt(width * height / 3.7));
+        int inner = static_cast<int>(outer * 0.535);
+        int frame_x = x + (width - outer) / 2;
+        int frame_y = y + (height - outer) / 2;
+
+        if (kind < 0.7)
+        {
+            fillBackground(cv::Rect(frame_x, frame_y, outer, outer));
+            fillObject(cv::Rect(frame_x + (outer - inner) / 2, frame_y + (outer - inner) / 2, inner, inner));
+            scene.ground_truth.push_back(cv::Vec4i(x, y, x + width - 1, y + height - 1));
+        }
+        else if (kind < 0.85)
+        {
+            fillBackground(cv::Rect(frame_x, frame_y, outer, outer));
+        }
+    }
+
+    // Salt and pepper noise and small holes, both should be removed by erosion and dilation
+    std::uniform_int_distribution<int> column(0, size.width - 3);
+    std::uniform_int_distribution<int> row(0, size.height - 3);
+    int noise_pixels = size.area() / 500;
+    for (int i = 0; i < noise_pixels; i++)
+    {
+        cv::Vec3b color = convertHSVToBGR(unit(rng) < 0.5 ? background_hue(rng) : object_hue(rng), 255, 255);
+        int hole = unit(rng) < 0.1 ? 2 : 1;
+        int x = column(rng);
+        int y = row(rng);
+        for (int dy = 0; dy < hole; dy++)
+        {
+            for (int dx = 0; dx < hole; dx++)
+            {
+                scene.image.at<cv::Vec3b>(y + dy, x + dx) = color;
+            }
+        }
+    }
+
+    if (illumination_gradient) applyIlluminationGradient(scene.image, rng);
+
+    return scene;
+}
+
+//! EVALUATION
+
+// Keeps the reference kernel's result alive so it isn't optimised out
+volatile uint64_t reference_sink = 0;
+
+// Fixed workload timed next to the pipeline, a plain 3x3 box sum over all channels of the frame
+// Pipeline time relative to it varies much less between machines than frames per second
+void runReferenceKernel(const cv::Mat& image)
+{
+    uint64_t checksum = 0;
+    for (int y = 1; y < image.rows - 1; y++)
+    {
+        const uchar* above = image.ptr<uchar>(y - 1);
+        const uchar* row = image.ptr<uchar>(y);
+        const uchar* below = image.ptr<uchar>(y + 1);
+        for (int x = 3; x < (image.cols - 1) * 3; x++)
+        {
+            checksum += above[x - 3] + above[x] + above[x + 3] + row[x - 3] + row[x] + row[x + 3] + below[x - 3] + below[x] + below[x + 3];
+        }
+    }
+    reference_sink = reference_sink + checksum;
+}
+
+struct BenchmarkResult
+{
+    double precision = 0;
+    double recall = 0;
+    double fps = 0;
+    double streaming_fps = 0;
+    // Frames processed in the time the reference kernel takes for one frame
+    double relative_throughput = 0;
+    // Whether the streaming pipeline produced exactly the same mask and ROIs
+    bool streaming_matches = true;
+    // Whether frames read back from a raw container gave the same results as the in-memory scenes
+    bool raw_frames_match = true;
+    // Whether runs through the ROI feature cache confirmed the same ROIs as uncached ones
+    bool cache_matches = true;
+    double cache_hit_rate = 0;
+};
+
+std::string getResolutionName(cv::Size size)
+{
+    return std::to_string(size.width) + "x" + std::to_string(size.height);
+}
+
+double getIoU(const cv::Vec4i& a, const cv::Vec4i& b)
+{
+    int width = std::min(a[2], b[2]) - std::max(a[0], b[0]) + 1;
+    int height = std::min(a[3], b[3]) - std::max(a[1], b[1]) + 1;
+    if (width <= 0 || height <= 0) return 0;
+
+    double intersection = static_cast<double>(width) * height;
+    double area_a = static_cast<double>(a[2] - a[0] + 1) * (a[3] - a[1] + 1);
+    double area_b = static_cast<double>(b[2] - b[0] + 1) * (b[3] - b[1] + 1);
+
+    return intersection / (area_a + area_b - intersection);
+}
+
+// Greedily matches detections to ground truth boxes, returns number of true positives
+int countMatches(const std::vector<cv::Vec4i>& detections, const std::vector<cv::Vec4i>& ground_truth, double min_iou)
+{
+    std::vector<bool> matched(ground_truth.size(), false);
+    int true_positives = 0;
+
+    for (auto& detection : detections)
+    {
+        for (size_t i = 0; i < ground_truth.size(); i++)
+        {
+            if (!matched[i] && getIoU(detection, ground_truth[i]) >= min_iou)
+            {
+                matched[i] = true;
+                true_positives++;
+                break;
+            }
+        }
+    }
+
+    return true_positives;
+}
+
+bool isSameMask(const cv::Mat& a, const cv::Mat& b)
+{
+    if (a.size() != b.size() || a.type() != b.type()) return false;
+
+    for (int y = 0; y < a.rows; y++)
+    {
+        if (std::memcmp(a.ptr<uchar>(y), b.ptr<uchar>(y), a.cols * a.elemSize()) != 0) return false;
+    }
+
+    return true;
+}
+
+// Moments are sums of integers, so both pipelines must agree exactly
+bool isSameOrientedBoxes(const std::vector<OrientedBox>& a, const std::vector<OrientedBox>& b)
+{
+    if (a.size() != b.size()) return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].centroid.x != b[i].centroid.x || a[i].centroid.y != b[i].centroid.y ||
+            a[i].angle != b[i].angle || a[i].major != b[i].major || a[i].minor != b[i].minor) return false;
+    }
+
+    return true;
+}
+
+bool isSameDetection(const DetectionResult& a, const DetectionResult& b)
+{
+    return isSameMask(a.mask, b.mask) && a.rois == b.rois && a.confirmed_rois == b.confirmed_rois && isSameOrientedBoxes(a.oriented_rois, b.oriented_rois);
+}
+
+// Runs every scene twice through a shared ROI feature cache, the second round is served from it
+// Returns false when any run confirms different ROIs than the uncached one
+bool checkFeatureCache(const std::vector<SyntheticScene>& scenes, const std::vector<DetectionResult>& detections, const DetectionParams& params,
+                       double& hit_rate)
+{
+    ROIFeatureCache cache(512);
+    bool matches = true;
+
+    for (int round = 0; round < 2; round++)
+    {
+        for (size_t i = 0; i < scenes.size(); i++)
+        {
+            DetectionResult cached = runDetection(scenes[i].image, params, &cache);
+            if (cached.confirmed_rois != detections[i].confirmed_rois || !isSameOrientedBoxes(cached.oriented_rois, detections[i].oriented_rois))
+            {
+                matches = false;
+            }
+        }
+    }
+
+    hit_rate = cache.getHitRate();
+    return matches;
+}
+
+// Writes the scenes into a raw container and runs detection on views of the mapped frames
+// Returns false when the container can't be written or read back, or any frame gives different results
+bool checkRawFrames(const std::vector<SyntheticScene>& scenes, const std::vector<DetectionResult>& detections, const DetectionParams& params,
+                    const std::string& name)
+{
+    std::vector<cv::Mat> frames;
+    for (const auto& scene : scenes) frames.push_back(scene.image);
+
+    fs::path path = fs::temp_directory_path() / ("prymat_benchmark_" + name + ".raw");
+    bool matches = saveRawFrames(path.string(), frames);
+
+    RawFrameReader reader;
+    if (matches) matches = reader.open(path.string()) && reader.getCount() == static_cast<int>(scenes.size());
+
+    for (int i = 0; matches && i < reader.getCount(); i++)
+    {
+        reader.prefetch(i + 1, 1);
+        matches = isSameDetection(runDetection(reader.frame(i), params), detections[i]);
+        reader.release(i, 1);
+    }
+
+    reader.close();
+    std::error_code error;
+    fs::remove(path, error);
+
+    return matches;
+}
+
+// Milliseconds taken by a single run
+template<typename Function>
+double timeRun(Function function)
+{
+    double elapsed = 0;
+    {
+        StageTimer timer(&elapsed);
+        function();
+    }
+    return elapsed;
+}
+
+// Times the reference kernel and every pipeline configuration on each scene, repeating the whole round a few times
+// Each configuration keeps its fastest round per scene, the minimum is far less affected by other load than the mean,
+// and interleaving the configurations lets load changes affect all of them alike
+// Throughput of each configuration is given relative to the reference kernel
+void measureRelativeThroughput(const std::vector<SyntheticScene>& scenes, const DetectionParams& params, double& full_frame, double& streaming,
+                               double& grayscale)
+{
+    DetectionParams grayscale_params = params;
+    grayscale_params.front_end = FrontEnd::GRAYSCALE;
+
+    double reference_ms = 0;
+    double grayscale_reference_ms = 0;
+    double full_frame_ms = 0;
+    double streaming_ms = 0;
+    double grayscale_ms = 0;
+
+    for (const auto& scene : scenes)
+    {
+        double reference = std::numeric_limits<double>::max();
+        double full_frame_run = reference;
+        double streaming_run = reference;
+        double grayscale_run = reference;
+
+        for (int i = 0; i < TIMING_REPEATS; i++)
+        {
+            double passes = timeRun([&] { for (int pass = 0; pass < REFERENCE_PASSES; pass++) runReferenceKernel(scene.image); });
+            reference = std::min(reference, passes / REFERENCE_PASSES);
+            full_frame_run = std::min(full_frame_run, timeRun([&] { runDetection(scene.image, params); }));
+            streaming_run = std::min(streaming_run, timeRun([&] { runStreamingDetection(scene.image, params); }));
+            if (scene.brightness_contrast) grayscale_run = std::min(grayscale_run, timeRun([&] { runDetection(scene.image, grayscale_params); }));
+        }
+
+        reference_ms += reference;
+        full_frame_ms += full_frame_run;
+        streaming_ms += streaming_run;
+        if (!scene.brightness_contrast) continue;
+        grayscale_reference_ms += reference;
+        grayscale_ms += grayscale_run;
+    }
+
+    full_frame = reference_ms / full_frame_ms;
+    streaming = reference_ms / streaming_ms;
+    grayscale = grayscale_reference_ms / grayscale_ms;
+}
+
+// Measures the grayscale front end on the brightness contrast scenes, objects differing in hue only are invisible to it
+BenchmarkResult runGrayscaleBenchmark(const std::vector<SyntheticScene>& scenes, const DetectionParams& params, StageTimings& timings)
+{
+    DetectionParams grayscale_params = params;
+    grayscale_params.front_end = FrontEnd::GRAYSCALE;
+
+    int true_positives = 0;
+    int detections = 0;
+    int objects = 0;
+    int frames = 0;
+
+    for (const auto& scene : scenes)
+    {
+        if (!scene.brightness_contrast) continue;
+        frames++;
+
+        cv::Mat image = scene.image;
+        DetectionResult detection = runDetection(image, grayscale_params, nullptr, &timings);
+        true_positives += countMatches(detection.confirmed_rois, scene.ground_truth, 0.5);
+        detections += static_cast<int>(detection.confirmed_rois.size());
+        objects += static_cast<int>(scene.ground_truth.size());
+    }
+
+    BenchmarkResult result;
+    result.precision = detections > 0 ? static_cast<double>(true_positives) / detections : 1;
+    result.recall = objects > 0 ? static_cast<double>(true_positives) / objects : 1;
+    result.fps = frames / (timings.total() / 1000.0);
+
+    return result;
+}
+
+// Streaming results carry the full frame accuracy, they're checked to be identical
+BenchmarkResult runBenchmark(cv::Size size, const DetectionParams& params, StageTimings& timings, StageTimings& streaming_timings,
+                             StageTimings& grayscale_timings, BenchmarkResult& streaming_result, BenchmarkResult& grayscale_result)
+{
+    BenchmarkResult result;
+
+    std::mt19937 rng(SCENE_SEED + size.width);
+    std::vector<SyntheticScene> scenes;
+    for (int i = 0; i < SCENES_PER_RESOLUTION; i++) scenes.push_back(generateScene(size, params, i % 2 == 1, i % 4 == 3, rng));
+
+    int true_positives = 0;
+    int detections = 0;
+    int objects = 0;
+    std::vector<DetectionResult> scene_detections;
+
+    for (auto& scene : scenes)
+    {
+        DetectionResult detection = runDetection(scene.image, params, nullptr, &timings);
+        true_positives += countMatches(detection.confirmed_rois, scene.ground_truth, 0.5);
+        detections += static_cast<int>(detection.confirmed_rois.size());
+        objects += static_cast<int>(scene.ground_truth.size());
+
+        DetectionResult streamed = runStreamingDetection(scene.image, params, nullptr, &streaming_timings);
+        if (!isSameDetection(detection, streamed)) result.streaming_matches = false;
+
+        scene_detections.push_back(std::move(detection));
+    }
+
+    // Zero-copy ingestion must see the same pixels and cache hits must repeat fresh results, neither is part of the timings
+    result.raw_frames_match = checkRawFrames(scenes, scene_detections, params, getResolutionName(size));
+    result.cache_matches = checkFeatureCache(scenes, scene_detections, params, result.cache_hit_rate);
+
+    result.precision = detections > 0 ? static_cast<double>(true_positives) / detections : 1;
+    result.recall = objects > 0 ? static_cast<double>(true_positives) / objects : 1;
+    result.fps = SCENES_PER_RESOLUTION / (timings.total() / 1000.0);
+    result.streaming_fps = SCENES_PER_RESOLUTION / (streaming_timings.total() / 1000.0);
+    grayscale_result = runGrayscaleBenchmark(scenes, params, grayscale_timings);
+
+    streaming_result = result;
+    streaming_result.fps = result.streaming_fps;
+    measureRelativeThroughput(scenes, params, result.relative_throughput, streaming_result.relative_throughput, grayscale_result.relative_throughput);
+
+    return result;
+}
+
+//! BASELINE
+
+// Baseline file holds one "<resolution> <precision> <recall> <relative throughput> [fps]" line per resolution and
+// configuration, streaming and grayscale front end entries carry a "-streaming" or "-grayscale" suffix
+// fps is 0 when the line has none, lines without relative throughput are skipped
+// Returns false when the file can't be read
+bool loadBaseline(const std::string& path, std::map<std::string, BenchmarkResult>& baseline)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream stream(line);
+        std::string name;
+        BenchmarkResult result;
+        if (!(stream >> name >> result.precision >> result.recall >> result.relative_throughput)) continue;
+        if (!(stream >> result.fps)) result.fps = 0;
+        baseline[name] = result;
+    }
+
+    return true;
+}
+
+bool saveBaseline(const std::string& path, const std::map<std::string, BenchmarkResult>& results, bool record_throughput)
+{
+    std::ofstream file(path);
+    file << "# resolution precision recall relative_throughput" << (record_throughput ? " fps\n" : "\n");
+    for (auto& [name, result] : results)
+    {
+        file << name << " " << result.precision << " " << result.recall << " " << result.relative_throughput;
+        if (record_throughput) file << " " << result.fps;
+        file << "\n";
+    }
+
+    return static_cast<bool>(file);
+}
+
+// Compares a result against its baseline entry and reports every regression
+bool isRegressed(const std::string& name, const BenchmarkResult& result, const BenchmarkResult& expected, double accuracy_tolerance,
+                 double relative_throughput_tolerance, double throughput_tolerance)
+{
+    bool regressed = false;
+    if (result.precision < expected.precision - accuracy_tolerance || result.recall < expected.recall - accuracy_tolerance)
+    {
+        std::cout << "  ACCURACY REGRESSION in " << name << ": baseline precision " << expected.precision << ", recall " << expected.recall << "\n";
+        regressed = true;
+    }
+    if (result.relative_throughput < expected.relative_throughput * (1 - relative_throughput_tolerance))
+    {
+        std::cout << "  THROUGHPUT REGRESSION in " << name << ": " << result.relative_throughput << " frames per reference frame, baseline "
+                  << expected.relative_throughput << "\n";
+        regressed = true;
+    }
+    if (expected.fps > 0 && result.fps < expected.fps * (1 - throughput_tolerance))
+    {
+        std::cout << "  THROUGHPUT REGRESSION in " << name << ": " << result.fps << " fps, baseline " << expected.fps << " fps\n";
+        regressed = true;
+    }
+
+    return regressed;
+}
+
+int main(int argc, char** argv)
+{
+    std::string baseline_path = "../benchmark_baseline.txt";
+    bool update_baseline = false;
+    bool record_throughput = false;
+    double accuracy_tolerance = 0.02;
+    double relative_throughput_tolerance = 0.2;
+    double throughput_tolerance = 0.15;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--update-baseline") update_baseline = true;
+        else if (arg == "--record-throughput") record_throughput = true;
+        else if (arg == "--baseline" && i + 1 < argc) baseline_path = argv[++i];
+        else if (arg == "--accuracy-tolerance" && i + 1 < argc) accuracy_tolerance = std::stod(argv[++i]);
+        else if (arg == "--relative-throughput-tolerance" && i + 1 < argc) relative_throughput_tolerance = std::stod(argv[++i]);
+        else if (arg == "--throughput-tolerance" && i + 1 < argc) throughput_tolerance = std::stod(argv[++i]);
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    DetectionParams params;
+    std::map<std::string, BenchmarkResult> results;
+    if (record_throughput && !update_baseline)
+    {
+        std::cerr << "--record-throughput only applies together with --update-baseline" << std::endl;
+        return 2;
+    }
+
+    std::map<std::string, BenchmarkResult> baseline;
+    if (!update_baseline && !loadBaseline(baseline_path, baseline))
+    {
+        std::cerr << "Unable to read baseline: " << baseline_path << ", run with --update-baseline to create it" << std::endl;
+        return 2;
+    }
+
+    bool regressed = false;
+
+    std::cout << std::fixed << std::setprecision(3);
+    for (cv::Size size : RESOLUTIONS)
+    {
+        StageTimings timings;
+        StageTimings streaming_timings;
+        StageTimings grayscale_timings;
+        BenchmarkResult streaming_result;
+        BenchmarkResult grayscale_result;
+        std::string name = getResolutionName(size);
+        BenchmarkResult result = runBenchmark(size, params, timings, streaming_timings, grayscale_timings, streaming_result, grayscale_result);
+
+        std::map<std::string, BenchmarkResult> configurations = {
+            {name, result},
+            {name + "-streaming", streaming_result},
+            {name + "-grayscale", grayscale_result}};
+        results.insert(configurations.begin(), configurations.end());
+
+        std::cout << name << ": precision " << result.precision << ", recall " << result.recall << ", " << result.fps << " fps, "
+                  << result.relative_throughput << " frames per reference frame\n";
+        std::cout << "  per frame ms: scale " << timings.scale / SCENES_PER_RESOLUTION
+                  << ", hsv " << timings.hsv / SCENES_PER_RESOLUTION
+                  << ", threshold " << timings.threshold / SCENES_PER_RESOLUTION
+                  << ", erosion " << timings.erosion / SCENES_PER_RESOLUTION
+                  << ", dilation " << timings.dilation / SCENES_PER_RESOLUTION
+                  << ", find ROIs " << timings.find_rois / SCENES_PER_RESOLUTION
+                  << ", analyse ROIs " << timings.analyse_rois / SCENES_PER_RESOLUTION << "\n";
+        std::cout << "  streaming: " << result.streaming_fps << " fps, " << streaming_result.relative_throughput << " frames per reference frame, per frame ms: streamed " << streaming_timings.streamed / SCENES_PER_RESOLUTION
+                  << ", analyse ROIs " << streaming_timings.analyse_rois / SCENES_PER_RESOLUTION << "\n";
+        std::cout << "  grayscale front end: precision " << grayscale_result.precision << ", recall " << grayscale_result.recall
+                  << ", " << grayscale_result.fps << " fps, " << grayscale_result.relative_throughput << " frames per reference frame"
+                  << ", per frame ms: grayscale " << grayscale_timings.grayscale / GRAYSCALE_SCENES
+                  << ", threshold " << grayscale_timings.threshold / GRAYSCALE_SCENES << "\n";
+        std::cout << "  feature cache: hit rate " << result.cache_hit_rate << "\n";
+
+        if (!result.streaming_matches)
+        {
+            std::cout << "  STREAMING MISMATCH: results differ from the full frame pipeline\n";
+            regressed = true;
+        }
+        if (!result.cache_matches)
+        {
+            std::cout << "  CACHE MISMATCH: cached ROI features confirmed different ROIs, hit rate " << result.cache_hit_rate << "\n";
+            regressed = true;
+        }
+        if (!result.raw_frames_match)
+        {
+            std::cout << "  RAW FRAME MISMATCH: frames read back from a raw container differ from the in-memory scenes\n";
+            regressed = true;
+        }
+
+        if (update_baseline) continue;
+
+        // Every measured configuration must be covered, otherwise a regression there would pass unnoticed
+        for (auto& [configuration, measured] : configurations)
+        {
+            auto it = baseline.find(configuration);
+            if (it == baseline.end()) std::cout << "  MISSING BASELINE ENTRY: " << configuration << "\n";
+            if (it == baseline.end() || isRegressed(configuration, measured, it->second, accuracy_tolerance, relative_throughput_tolerance, throughput_tolerance)) regressed = true;
+        }
+    }
+
+    if (update_baseline)
+    {
+        if (!saveBaseline(baseline_path, results, record_throughput))
+        {
+            std::cerr << "Unable to write baseline: " << baseline_path << std::endl;
+            return 1;
+        }
+        std::cout << "Baseline written to " << baseline_path << std::endl;
+    }
+
+    return regressed ? 1 : 0;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
@@ -275,4 +277,74 @@ int getPerimeter(const cv::Mat& image) {
     }
     
     return perimeter;
-}
\ No newline at end of file
+}
+
+// ORIENTED BOXES
+
+// Raw moments of a pixel set gathered while it's being visited, i is the row and j the column as in m()
+struct ShapeMoments
+{
+    double m00 = 0;
+    double m10 = 0;
+    double m01 = 0;
+    double m20 = 0;
+    double m02 = 0;
+    double m11 = 0;
+
+    void addPixel(int i, int j)
+    {
+        m00 += 1;
+        m10 += i;
+        m01 += j;
+        m20 += static_cast<double>(i) * i;
+        m02 += static_cast<double>(j) * j;
+        m11 += static_cast<double>(i) * j;
+    }
+
+    void merge(const ShapeMoments& other)
+    {
+        m00 += other.m00;
+        m10 += other.m10;
+        m01 += other.m01;
+        m20 += other.m20;
+        m02 += other.m02;
+        m11 += other.m11;
+    }
+};
+
+// Box of the ellipse with the same second order moments as the shape
+// Angle of the major axis is given in degrees from the x axis towards y, extents are full axis lengths
+struct OrientedBox
+{
+    cv::Point2d centroid;
+    double angle = 0;
+    double major = 0;
+    double minor = 0;
+};
+
+// Moments gathered on a resampled image are mapped back through the per axis sampling factors, the covariance
+// is transformed as a whole so unequal factors also correct the angle and extents
+OrientedBox getOrientedBox(const ShapeMoments& moments, double x_scale = 1, double y_scale = 1)
+{
+    OrientedBox box;
+    if (moments.m00 == 0) return box;
+
+    double center_i = moments.m10 / moments.m00;
+    double center_j = moments.m01 / moments.m00;
+    box.centroid = cv::Point2d(center_j * x_scale, center_i * y_scale);
+
+    // Normalised central moments, x runs along columns and y along rows
+    double mu_xx = (moments.m02 / moments.m00 - center_j * center_j) * x_scale * x_scale;
+    double mu_yy = (moments.m20 / moments.m00 - center_i * center_i) * y_scale * y_scale;
+    double mu_xy = (moments.m11 / moments.m00 - center_i * center_j) * x_scale * y_scale;
+
+    double common = std::sqrt(std::pow(mu_xx - mu_yy, 2) + 4 * mu_xy * mu_xy);
+    double lambda_major = std::max((mu_xx + mu_yy + common) / 2, 0.0);
+    double lambda_minor = std::max((mu_xx + mu_yy - common) / 2, 0.0);
+
+    box.angle = 0.5 * std::atan2(2 * mu_xy, mu_xx - mu_yy) * 180.0 / CV_PI;
+    box.major = 4 * std::sqrt(lambda_major);
+    box.minor = 4 * std::sqrt(lambda_minor);
+
+    return box;
+}
@@ -2,54 +2,169 @@
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
 #include <iostream>
-#include "utils.h"
+#include "pipeline.h"
+#include "streaming.h"
+#include "raw_frames.h"
+#include "output.h"
 
 const std::string IMG1 = "C:\\Users\\kamil\\Desktop\\Repos\\prymat_detection\\img\\1.jpeg";
 const std::string IMG2 = "C:\\Users\\kamil\\Desktop\\Repos\\prymat_detection\\img\\2.jpeg";
 const std::string IMG3 = "C:\\Users\\kamil\\Desktop\\Repos\\prymat_detection\\img\\3.jpeg";
 
-// HSV minV 150 maxS 40 - 1. wersja
-// teraz - minH 10, maxH 150
+// Number of frames hinted to the kernel ahead of the one being processed
+const int PREFETCH_FRAMES = 4;
 
-int main()
+// Image encoding runs on its own threads and may hold at most this many bytes of queued images
+const int ENCODER_THREADS = 2;
+const size_t ENCODER_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+// Optional image and console outputs, detection records are always written
+struct OutputOptions
+{
+    bool save_images = false;
+    bool save_debug_images = false;
+    // Console output is synchronous, batch runs leave the counts to the detection records
+    bool print_counts = false;
+};
+
+// Runs the detection pipeline on a single BGR frame and queues the results under given name
+// Streaming pushes row bands through the stages and gives the same results as the full frame pipeline
+void detectObjects(const cv::Mat& img, const DetectionParams& params, bool streaming, ROIFeatureCache& feature_cache, StageTimings& timings,
+                   const std::string& name, const OutputOptions& options, DetectionWriter& writer, ImageEncoderPool& encoder)
 {
-    // Load an image
-    cv::Mat img = cv::imread(IMG3);
+    DetectionResult result = streaming ? runStreamingDetection(img, params, &feature_cache, &timings)
+                                       : runDetection(img, params, &feature_cache, &timings);
+    if (options.print_counts)
+    {
+        std::cout << "ROIs found: " << result.rois.size() << "\n";
+        std::cout << "ROIs marked: " << result.confirmed_rois.size() << "\n";
+    }
+
+    // Save image with all ROIs marked, the mask is kept alive by the job until it's encoded
+    if (options.save_debug_images)
+    {
+        cv::Mat mask = result.mask;
+        encoder.submit("../detection_ROIs_" + name + ".png", mask.total() * 4, [mask, rois = result.rois]() { return showROIs(mask, rois); });
+    }
+
+    // Save image with confirmed ROIs marked, the frame is copied since it may be a view into a mapping
+    if (options.save_images)
+    {
+        cv::Mat out_image = img.clone();
+        encoder.submit("../detection_" + name + ".jpeg", out_image.total() * out_image.elemSize(), [out_image, rois = result.confirmed_rois]() mutable
+        {
+            markDetections(out_image, rois);
+            return out_image;
+        });
+    }
+
+    writer.write(DetectionRecord{name, std::move(result.confirmed_rois), std::move(result.oriented_rois)});
+}
+
+// Usage: prymat_detection [--images] [--debug-images] [--binary] [--grayscale | --streaming] [frames.raw]
+// Without an input a single JPEG is processed with all image outputs, otherwise every frame of the raw container
+int main(int argc, char** argv)
+{
+    OutputOptions options;
+    DetectionParams params;
+    bool streaming = false;
+    RecordFormat format = RecordFormat::JSON_LINES;
+    std::string input;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--images") options.save_images = true;
+        else if (arg == "--debug-images") options.save_debug_images = true;
+        else if (arg == "--binary") format = RecordFormat::BINARY;
+        else if (arg == "--grayscale") params.front_end = FrontEnd::GRAYSCALE;
+        else if (arg == "--streaming") streaming = true;
+        else input = arg;
+    }
+
+    if (streaming && params.front_end != FrontEnd::HSV)
+    {
+        std::cerr << "--streaming only supports the HSV front end, it can't be combined with --grayscale" << std::endl;
+        return 1;
+    }
+
+    std::string records_path = format == RecordFormat::BINARY ? "../detections.bin" : "../detections.jsonl";
+    DetectionWriter writer(records_path, format);
+    if (!writer.isOpen())
+    {
+        std::cerr << "Unable to open detection output: " << records_path << std::endl;
+        return 1;
+    }
+    ImageEncoderPool encoder(ENCODER_THREADS, ENCODER_MEMORY_BUDGET);
 
-    // Scale the image down
-    int scale = 30;
-    auto scaled_img = scaleImage(img, scale);
-    
-    // Convert image from BGR to HSV
-    auto hsv_img = convertToHSV(scaled_img);
+    ROIFeatureCache feature_cache(512);
+    StageTimings timings;
+    int frames = 0;
 
-    // Apply thresholding based on lower and upper margins
-    std::vector<uchar> lower_margin = {10, 0, 0};
-    std::vector<uchar> upper_margin = {150, 255, 255};
-    auto thresholded_img = applyHSVThresholding(hsv_img, lower_margin, upper_margin);
+    if (input.empty())
+    {
+        // Load an image
+        cv::Mat img = cv::imread(IMG3);
+        options.save_images = true;
+        options.save_debug_images = true;
+        options.print_counts = true;
+        detectObjects(img, params, streaming, feature_cache, timings, "IMG1", options, writer, encoder);
+        frames = 1;
+    }
+    else
+    {
+        // Map the raw frame container, frames are consumed as views without decoding or copying
+        RawFrameReader reader;
+        if (!reader.open(input))
+        {
+            std::cerr << "Unable to open raw frame container: " << input << std::endl;
+            return 1;
+        }
 
-    // Apply erosion to black pixels
-    auto eroded_img = applyErosion(thresholded_img, 3, 0);
+        reader.prefetch(0, PREFETCH_FRAMES);
+        for (int i = 0; i < reader.getCount(); i++)
+        {
+            reader.prefetch(i + 1, PREFETCH_FRAMES);
 
-    // Apply dilation to black pixels
-    auto dilated_img = applyDilation(eroded_img, 3, 0);
+            cv::Mat frame = reader.frame(i);
+            detectObjects(frame, params, streaming, feature_cache, timings, "FRAME" + std::to_string(i), options, writer, encoder);
+            frames++;
 
-    // Find all ROIs
-    std::vector<cv::Vec4i> rois = findROIs(dilated_img, 75, 50, hsv_img.cols / 2, hsv_img.rows / 2);
-    std::cout << "ROIs found: " << rois.size() << std::endl;
+            reader.release(i, 1);
+        }
+    }
 
-    // Save image with all ROIs marked
-    cv::imwrite("../detection_ROIs.png", showROIs(dilated_img, rois));
+    std::cout << "Feature cache hit rate: " << feature_cache.getHitRate() << std::endl;
 
-    // Test all ROIs and retain only those that meet the criteria
-    std::vector<cv::Vec4i> final_rois = analyseROIs(dilated_img, rois);
-    std::cout << "ROIs marked: " << final_rois.size() << std::endl;
+    // Average time per frame of each stage, front end stages show the cost of HSV against grayscale
+    if (frames > 0)
+    {
+        std::cout << "Per frame ms: scale " << timings.scale / frames
+                  << ", hsv " << timings.hsv / frames
+                  << ", grayscale " << timings.grayscale / frames
+                  << ", threshold " << timings.threshold / frames
+                  << ", erosion " << timings.erosion / frames
+                  << ", dilation " << timings.dilation / frames
+                  << ", find ROIs " << timings.find_rois / frames
+                  << ", streamed " << timings.streamed / frames
+                  << ", analyse ROIs " << timings.analyse_rois / frames << std::endl;
+    }
 
-    // Adjust ROI coordinates so they fit the original image
-    adjustScaledValues(final_rois, scale);
+    // Drain both output queues so their failures are known before reporting success
+    writer.finish();
+    encoder.finish();
 
-    // Save image with confirmed ROIs marked
-    saveDetectionResults(img, final_rois, "IMG1");
+    bool output_failed = false;
+    if (writer.getFailures() > 0)
+    {
+        std::cerr << "Failed to write " << writer.getFailures() << " detection records: " << writer.getFirstError() << std::endl;
+        output_failed = true;
+    }
+    if (encoder.getFailures() > 0)
+    {
+        std::cerr << "Failed to save " << encoder.getFailures() << " images: " << encoder.getFirstError() << std::endl;
+        output_failed = true;
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return output_failed ? 1 : 0;
+}
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "m_values.h"
+
+//! DETECTION RECORDS
+
+enum class RecordFormat
+{
+    JSON_LINES,
+    BINARY
+};
+
+struct DetectionRecord
+{
+    std::string name;
+    std::vector<cv::Vec4i> rois;
+    // Either empty or one oriented box per ROI
+    std::vector<OrientedBox> oriented_rois;
+};
+
+// Appends a record as a single JSON line:
+// {"name":"...","rois":[[x1,y1,x2,y2],...],"oriented":[[cx,cy,angle,major,minor],...]}
+void formatJSONLine(const DetectionRecord& record, std::string& out)
+{
+    out += "{\"name\":\"";
+    for (char c : record.name)
+    {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    out += "\",\"rois\":[";
+
+    for (size_t i = 0; i < record.rois.size(); i++)
+    {
+        const cv::Vec4i& roi = record.rois[i];
+        if (i > 0) out += ',';
+        out += '[' + std::to_string(roi[0]) + ',' + std::to_string(roi[1]) + ',' + std::to_string(roi[2]) + ',' + std::to_string(roi[3]) + ']';
+    }
+
+    out += "],\"oriented\":[";
+    char values[160];
+    for (size_t i = 0; i < record.oriented_rois.size(); i++)
+    {
+        const OrientedBox& box = record.oriented_rois[i];
+        if (i > 0) out += ',';
+        std::snprintf(values, sizeof(values), "[%.2f,%.2f,%.2f,%.2f,%.2f]", box.centroid.x, box.centroid.y, box.angle, box.major, box.minor);
+        out += values;
+    }
+
+    out += "]}\n";
+}
+
+// Appends a record in binary form: uint32 name length, name, uint32 ROI count, 4 x int32 per ROI,
+// uint32 oriented box count, 5 x float64 per oriented box (cx, cy, angle, major, minor)
+void formatBinary(const DetectionRecord& record, std::string& out)
+{
+    auto append = [&](const void* data, size_t size) { out.append(static_cast<const char*>(data), size); };
+
+    uint32_t name_length = static_cast<uint32_t>(record.name.size());
+    uint32_t count = static_cast<uint32_t>(record.rois.size());
+
+    append(&name_length, sizeof(name_length));
+    append(record.name.data(), name_length);
+    append(&count, sizeof(count));
+    for (const cv::Vec4i& roi : record.rois)
+    {
+        int32_t values[4] = {roi[0], roi[1], roi[2], roi[3]};
+        append(values, sizeof(values));
+    }
+
+    uint32_t oriented_count = static_cast<uint32_t>(record.oriented_rois.size());
+    append(&oriented_count, sizeof(oriented_count));
+    for (const OrientedBox& box : record.oriented_rois)
+    {
+        double values[5] = {box.centroid.x, box.centroid.y, box.angle, box.major, box.minor};
+        append(values, sizeof(values));
+    }
+}
+
+// Writes detection records to a file on a background thread, so the compute thread never blocks on I/O
+class DetectionWriter
+{
+public:
+    DetectionWriter(const std::string& path, RecordFormat format, size_t max_pending = 1024)
+        : format(format), max_pending(max_pending)
+    {
+        std::ios::openmode mode = std::ios::out | std::ios::trunc;
+        if (format == RecordFormat::BINARY) mode |= std::ios::binary;
+        file.open(path, mode);
+        worker = std::thread(&DetectionWriter::run, this);
+    }
+
+    DetectionWriter(const DetectionWriter&) = delete;
+    DetectionWriter& operator=(const DetectionWriter&) = delete;
+
+    ~DetectionWriter() { finish(); }
+
+    bool isOpen() const { return file.is_open(); }
+
+    // Writes out all queued records and stops the background thread, records queued afterwards are dropped
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        not_empty.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+
+    // Number of records that couldn't be written, only final once finish() returned
+    size_t getFailures() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failures;
+    }
+
+    std::string getFirstError() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return first_error;
+    }
+
+    // Queues a record, blocks only when max_pending records are already waiting
+    void write(DetectionRecord record)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&] { return pending.size() < max_pending; });
+        if (stopping)
+        {
+            recordFailure(1, "record queued after finish: " + record.name);
+            return;
+        }
+        pending.push_back(std::move(record));
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+private:
+    void run()
+    {
+        std::deque<DetectionRecord> batch;
+        std::string buffer;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                not_empty.wait(lock, [&] { return stopping || !pending.empty(); });
+                if (pending.empty()) break;
+                batch.swap(pending);
+            }
+            not_full.notify_all();
+
+            // Format the whole batch and hand it to the stream with a single write
+            try
+            {
+                buffer.clear();
+                for (const DetectionRecord& record : batch)
+                {
+                    if (format == RecordFormat::JSON_LINES) formatJSONLine(record, buffer);
+                    else formatBinary(record, buffer);
+                }
+
+                file.write(buffer.data(), buffer.size());
+                file.flush();
+                if (!file) throw std::runtime_error("write to detection output failed");
+            }
+            catch (const std::exception& e)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                recordFailure(batch.size(), e.what());
+            }
+            batch.clear();
+        }
+    }
+
+    // Must be called with the mutex held
+    void recordFailure(size_t count, const std::string& error)
+    {
+        if (failures == 0) first_error = error;
+        failures += count;
+    }
+
+    RecordFormat format;
+    size_t max_pending;
+    std::ofstream file;
+    std::deque<DetectionRecord> pending;
+    size_t failures = 0;
+    std::string first_error;
+    mutable std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    bool stopping = false;
+    std::thread worker;
+};
+
+//! ASYNCHRONOUS IMAGE ENCODING
+
+// Renders and encodes images on a pool of worker threads, memory held by queued images is bounded
+class ImageEncoderPool
+{
+public:
+    ImageEncoderPool(int threads, size_t max_pending_bytes) : max_pending_bytes(max_pending_bytes)
+    {
+        for (int i = 0; i < std::max(threads, 1); i++)
+        {
+            workers.emplace_back(&ImageEncoderPool::run, this);
+        }
+    }
+
+    ImageEncoderPool(const ImageEncoderPool&) = delete;
+    ImageEncoderPool& operator=(const ImageEncoderPool&) = delete;
+
+    ~ImageEncoderPool() { finish(); }
+
+    // Encodes all queued images and stops the workers, images submitted afterwards are dropped
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        not_empty.notify_all();
+        for (auto& worker : workers)
+        {
+            if (worker.joinable()) worker.join();
+        }
+    }
+
+    // Number of images that failed to render or encode, only final once finish() returned
+    size_t getFailures() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failures;
+    }
+
+    std::string getFirstError() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return first_error;
+    }
+
+    // Queues rendering of an image which is then written to given path
+    // Bytes should cover the memory the job keeps alive, the caller blocks while the budget is exceeded
+    void submit(const std::string& path, size_t bytes, std::function<cv::Mat()> render)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&] { return pending_bytes == 0 || pending_bytes + bytes <= max_pending_bytes; });
+        if (stopping)
+        {
+            recordFailure(path + ": image submitted after finish");
+            return;
+        }
+        pending_bytes += bytes;
+        jobs.push_back(Job{path, bytes, std::move(render)});
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+private:
+    struct Job
+    {
+        std::string path;
+        size_t bytes;
+        std::function<cv::Mat()> render;
+    };
+
+    void run()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                not_empty.wait(lock, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) break;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            // Exceptions must not leave the worker, they would terminate the whole program
+            std::string error;
+            try
+            {
+                if (!cv::imwrite(job.path, job.render())) error = job.path + ": imwrite failed";
+            }
+            catch (const std::exception& e)
+            {
+                error = job.path + ": " + e.what();
+            }
+            job.render = nullptr;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending_bytes -= job.bytes;
+                if (!error.empty()) recordFailure(error);
+            }
+            not_full.notify_all();
+        }
+    }
+
+    // Must be called with the mutex held
+    void recordFailure(const std::string& error)
+    {
+        if (failures == 0) first_error = error;
+        failures++;
+    }
+
+    size_t max_pending_bytes;
+    size_t pending_bytes = 0;
+    std::deque<Job> jobs;
+    size_t failures = 0;
+    std::string first_error;
+    mutable std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
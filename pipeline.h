@@ -0,0 +1,195 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <chrono>
+#include "utils.h"
+
+//! DETECTION PIPELINE
+
+// HSV minV 150 maxS 40 - 1. wersja
+// teraz - minH 10, maxH 150
+
+// Stages turning the scaled BGR image into a binary mask
+enum class FrontEnd
+{
+    // HSV conversion with hue, saturation and value margins
+    HSV,
+    // Grayscale conversion with local mean thresholding
+    GRAYSCALE
+};
+
+struct DetectionParams
+{
+    int scale = 30;
+    FrontEnd front_end = FrontEnd::HSV;
+    std::vector<uchar> lower_margin = {10, 0, 0};
+    std::vector<uchar> upper_margin = {150, 255, 255};
+    // Side of the block whose mean the grayscale threshold compares against, 0 derives it from the minimum ROI size
+    int adaptive_block_size = 0;
+    int adaptive_offset = 5;
+    int mask_size = 3;
+    int min_width = 75;
+    int min_height = 50;
+};
+
+// Time spent in each stage of the pipeline in milliseconds, accumulated over all runs
+struct StageTimings
+{
+    double scale = 0;
+    double hsv = 0;
+    double grayscale = 0;
+    double threshold = 0;
+    double erosion = 0;
+    double dilation = 0;
+    double find_rois = 0;
+    double analyse_rois = 0;
+    // Scale through labeling fused into row bands by the streaming pipeline
+    double streamed = 0;
+
+    double total() const { return scale + hsv + grayscale + threshold + erosion + dilation + find_rois + analyse_rois + streamed; }
+};
+
+struct DetectionResult
+{
+    // Mask after morphology, in scaled image coordinates
+    cv::Mat mask;
+    // All ROIs found in the mask, in scaled image coordinates
+    std::vector<cv::Vec4i> rois;
+    // ROIs that passed the analysis, in original image coordinates
+    std::vector<cv::Vec4i> confirmed_rois;
+    // Oriented boxes of the confirmed ROIs' components, in original image coordinates
+    std::vector<OrientedBox> oriented_rois;
+};
+
+// Measures the duration of a single pipeline stage and adds it to given counter
+class StageTimer
+{
+public:
+    explicit StageTimer(double* counter) : counter(counter), start(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer()
+    {
+        if (counter != nullptr) *counter += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    double* counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Block size of the adaptive threshold
+// A block within a uniform object puts its interior at the local mean and turns it black, while a block spanning
+// the frame turns into a global threshold that can't follow uneven lighting. Twice the minimum ROI side keeps
+// surroundings in the blocks of objects and still tracks illumination across the frame
+int getAdaptiveBlockSize(const DetectionParams& params)
+{
+    if (params.adaptive_block_size > 0) return params.adaptive_block_size;
+    return std::max({params.min_width, params.min_height, 1}) * 2 + 1;
+}
+
+// Fills oriented boxes of confirmed ROIs from moments of all found ROIs and brings everything to original image coordinates
+// Mean distance between position * factor and the pixel scaleImage samples for it, which is rounded down
+double getMeanSamplingOffset(int out_length, double factor)
+{
+    double offset = 0;
+    for (int i = 0; i < out_length; i++) offset += i * factor - static_cast<int>(i * factor);
+    return out_length > 0 ? offset / out_length : 0;
+}
+
+// Oriented boxes use the factors scaleImage actually sampled with, they differ from the nominal scale per axis
+// Centroids are also moved by the mean rounding of the sampling, so they land on original pixel coordinates
+void finishDetection(DetectionResult& result, const std::vector<ShapeMoments>& moments, const std::vector<int>& confirmed_indices, double scale,
+                     cv::Size original_size)
+{
+    if (!confirmed_indices.empty())
+    {
+        double x_scale = static_cast<double>(original_size.width) / result.mask.cols;
+        double y_scale = static_cast<double>(original_size.height) / result.mask.rows;
+        double x_offset = getMeanSamplingOffset(result.mask.cols, x_scale);
+        double y_offset = getMeanSamplingOffset(result.mask.rows, y_scale);
+
+        for (int index : confirmed_indices)
+        {
+            OrientedBox box = getOrientedBox(moments[index], x_scale, y_scale);
+            box.centroid.x -= x_offset;
+            box.centroid.y -= y_offset;
+            result.oriented_rois.push_back(box);
+        }
+    }
+
+    // Adjust ROI coordinates so they fit the original image
+    adjustScaledValues(result.confirmed_rois, scale);
+}
+
+// Runs all detection stages on a single BGR image
+DetectionResult runDetection(const cv::Mat& img, const DetectionParams& params, ROIFeatureCache* cache = nullptr, StageTimings* timings = nullptr)
+{
+    DetectionResult result;
+    auto counter = [&](double StageTimings::* stage) { return timings != nullptr ? &(timings->*stage) : nullptr; };
+
+    // Scale the image down
+    cv::Mat scaled_img;
+    {
+        StageTimer timer(counter(&StageTimings::scale));
+        scaled_img = scaleImage(img, params.scale);
+    }
+
+    cv::Mat thresholded_img;
+    if (params.front_end == FrontEnd::HSV)
+    {
+        // Convert image from BGR to HSV
+        cv::Mat hsv_img;
+        {
+            StageTimer timer(counter(&StageTimings::hsv));
+            hsv_img = convertToHSV(scaled_img);
+        }
+
+        // Apply thresholding based on lower and upper margins
+        StageTimer timer(counter(&StageTimings::threshold));
+        thresholded_img = applyHSVThresholding(hsv_img, params.lower_margin, params.upper_margin);
+    }
+    else
+    {
+        // Convert image from BGR to grayscale
+        cv::Mat grayscale_img;
+        {
+            StageTimer timer(counter(&StageTimings::grayscale));
+            grayscale_img = convertToGrayscale(scaled_img);
+        }
+
+        // Apply thresholding based on local mean intensity
+        StageTimer timer(counter(&StageTimings::threshold));
+        thresholded_img = applyAdaptiveThresholding(grayscale_img, getAdaptiveBlockSize(params), params.adaptive_offset);
+    }
+
+    // Apply erosion to black pixels
+    cv::Mat eroded_img;
+    {
+        StageTimer timer(counter(&StageTimings::erosion));
+        eroded_img = applyErosion(thresholded_img, params.mask_size, 0);
+    }
+
+    // Apply dilation to black pixels
+    {
+        StageTimer timer(counter(&StageTimings::dilation));
+        result.mask = applyDilation(eroded_img, params.mask_size, 0);
+    }
+
+    // Find all ROIs
+    std::vector<ShapeMoments> moments;
+    {
+        StageTimer timer(counter(&StageTimings::find_rois));
+        result.rois = findROIs(result.mask, params.min_width, params.min_height, scaled_img.cols / 2, scaled_img.rows / 2, &moments);
+    }
+
+    // Test all ROIs and retain only those that meet the criteria
+    std::vector<int> confirmed_indices;
+    {
+        StageTimer timer(counter(&StageTimings::analyse_rois));
+        result.confirmed_rois = analyseROIs(result.mask, result.rois, cache, &confirmed_indices);
+    }
+
+    finishDetection(result, moments, confirmed_indices, params.scale, img.size());
+
+    return result;
+}
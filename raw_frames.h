@@ -0,0 +1,253 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//! RAW FRAME CONTAINER
+// Layout: RawFrameHeader, padding up to data_offset, then count frames of height * stride bytes (BGR, 8 bit)
+
+struct RawFrameHeader
+{
+    char magic[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t count;
+    uint32_t data_offset;
+};
+
+const char RAW_FRAME_MAGIC[4] = {'P', 'R', 'A', 'W'};
+const uint32_t RAW_FRAME_ALIGNMENT = 4096;
+
+// Writes BGR frames of equal size into a raw container with page aligned frame data
+bool saveRawFrames(const std::string& path, const std::vector<cv::Mat>& frames)
+{
+    if (frames.empty()) return false;
+
+    int width = frames[0].cols;
+    int height = frames[0].rows;
+    for (auto& frame : frames)
+    {
+        CV_Assert(frame.type() == CV_8UC3 && frame.cols == width && frame.rows == height);
+    }
+
+    RawFrameHeader header;
+    std::memcpy(header.magic, RAW_FRAME_MAGIC, sizeof(header.magic));
+    header.width = width;
+    header.height = height;
+    header.stride = width * 3;
+    header.count = static_cast<uint32_t>(frames.size());
+    header.data_offset = RAW_FRAME_ALIGNMENT;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    std::vector<char> padding(header.data_offset - sizeof(header), 0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding.data(), padding.size());
+
+    for (auto& frame : frames)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            file.write(reinterpret_cast<const char*>(frame.ptr<uchar>(y)), header.stride);
+        }
+    }
+
+    return static_cast<bool>(file);
+}
+
+// Memory maps a raw frame container and hands out cv::Mat views of its frames without copying
+class RawFrameReader
+{
+public:
+    RawFrameReader() = default;
+    RawFrameReader(const RawFrameReader&) = delete;
+    RawFrameReader& operator=(const RawFrameReader&) = delete;
+
+    ~RawFrameReader() { close(); }
+
+    // Maps the container and validates its header, returns false if the file can't be used
+    bool open(const std::string& path)
+    {
+        close();
+
+#ifdef _WIN32
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        size = static_cast<size_t>(file_size.QuadPart);
+
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_handle == nullptr)
+        {
+            close();
+            return false;
+        }
+
+        // Read-only view, a stray write through a frame faults instead of quietly copying pages
+        data = static_cast<uchar*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        if (data == nullptr)
+        {
+            close();
+            return false;
+        }
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+        {
+            close();
+            return false;
+        }
+        size = static_cast<size_t>(file_stat.st_size);
+
+        // Read-only mapping, a stray write through a frame faults instead of quietly allocating private pages
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        data = static_cast<uchar*>(mapping);
+        madvise(data, size, MADV_SEQUENTIAL);
+#endif
+
+        if (size < sizeof(RawFrameHeader))
+        {
+            close();
+            return false;
+        }
+
+        std::memcpy(&header, data, sizeof(header));
+        if (!isValidHeader())
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (data != nullptr) UnmapViewOfFile(data);
+        if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+        if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (data != nullptr) munmap(data, size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+        header = RawFrameHeader();
+    }
+
+    bool isOpen() const { return data != nullptr; }
+    int getCount() const { return static_cast<int>(header.count); }
+    int getWidth() const { return static_cast<int>(header.width); }
+    int getHeight() const { return static_cast<int>(header.height); }
+
+    // Returns a view of given frame pointing straight into the read-only mapping, it must not be written to
+    cv::Mat frame(int index) const
+    {
+        CV_Assert(isOpen() && index >= 0 && index < getCount());
+        return cv::Mat(header.height, header.width, CV_8UC3, frameData(index), header.stride);
+    }
+
+    // Hints the kernel to start reading given range of frames ahead of their use
+    void prefetch(int first, int count) const
+    {
+        adviseFrames(first, count, true);
+    }
+
+    // Drops pages of already processed frames so resident memory stays flat
+    void release(int first, int count) const
+    {
+        adviseFrames(first, count, false);
+    }
+
+private:
+    // Checks the header against the mapped size, all arithmetic is 64 bit so corrupt fields can't wrap around
+    bool isValidHeader() const
+    {
+        if (std::memcmp(header.magic, RAW_FRAME_MAGIC, sizeof(header.magic)) != 0) return false;
+        if (header.width == 0 || header.height == 0) return false;
+        if (header.width > static_cast<uint32_t>(std::numeric_limits<int>::max()) ||
+            header.height > static_cast<uint32_t>(std::numeric_limits<int>::max())) return false;
+        if (static_cast<uint64_t>(header.stride) < static_cast<uint64_t>(header.width) * 3) return false;
+        if (header.data_offset < sizeof(RawFrameHeader) || header.data_offset > size) return false;
+
+        // Count * frame bytes can exceed 64 bits, compare against the available frames instead
+        uint64_t frame_bytes = static_cast<uint64_t>(header.stride) * header.height;
+        return header.count <= (size - header.data_offset) / frame_bytes;
+    }
+
+    size_t frameBytes() const { return static_cast<size_t>(header.stride) * header.height; }
+    uchar* frameData(int index) const { return data + header.data_offset + index * frameBytes(); }
+
+    void adviseFrames(int first, int count, bool will_need) const
+    {
+        if (!isOpen()) return;
+        first = std::max(first, 0);
+        int last = std::min(first + count, getCount());
+        if (first >= last) return;
+
+#ifdef _WIN32
+        // No portable equivalent, FILE_FLAG_SEQUENTIAL_SCAN already enables read ahead
+        (void)will_need;
+#else
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t begin = static_cast<size_t>(frameData(first) - data);
+        size_t end = static_cast<size_t>(frameData(last) - data);
+
+        // Prefetching may round outwards, releasing only covers pages fully inside the range
+        if (will_need) begin = begin / page * page;
+        else
+        {
+            begin = (begin + page - 1) / page * page;
+            end = end / page * page;
+        }
+        if (begin >= end) return;
+
+        madvise(data + begin, end - begin, will_need ? MADV_WILLNEED : MADV_DONTNEED);
+#endif
+    }
+
+    RawFrameHeader header = RawFrameHeader();
+    uchar* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
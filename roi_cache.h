@@ -0,0 +1,132 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <unordered_map>
+
+// Shape features of a single ROI together with the accept/reject decision
+struct ROIFeatures
+{
+    double M6 = 0;
+    double M7 = 0;
+    double area_diff = 0;
+    bool accepted = false;
+};
+
+// Fast 64-bit hash of a (possibly non-continuous) single channel ROI mask
+uint64_t hashROIMask(const cv::Mat& image)
+{
+    CV_Assert(image.type() == CV_8UC1);
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    auto mix = [&](uint64_t word)
+    {
+        hash ^= word;
+        hash *= prime;
+        hash ^= hash >> 32;
+    };
+
+    mix(static_cast<uint64_t>(image.rows) << 32 | static_cast<uint32_t>(image.cols));
+
+    for (int y = 0; y < image.rows; y++)
+    {
+        const uchar* row = image.ptr<uchar>(y);
+        int x = 0;
+        for (; x + 8 <= image.cols; x += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, row + x, sizeof(word));
+            mix(word);
+        }
+
+        uint64_t tail = 0;
+        std::memcpy(&tail, row + x, image.cols - x);
+        mix(tail);
+    }
+
+    return hash;
+}
+
+// Bounded LRU cache mapping ROI mask hashes to their computed features
+// Entries also keep the mask size, so a hash collision between masks of different sizes is treated as a miss
+class ROIFeatureCache
+{
+public:
+    explicit ROIFeatureCache(size_t capacity) : capacity(capacity) {}
+
+    // Looks up features for given key and mask size and marks the entry as most recently used
+    bool find(uint64_t key, cv::Size size, ROIFeatures& features)
+    {
+        auto it = index.find(key);
+        if (it == index.end() || it->second->size != size)
+        {
+            misses++;
+            return false;
+        }
+
+        entries.splice(entries.begin(), entries, it->second);
+        features = it->second->features;
+        hits++;
+        return true;
+    }
+
+    // Stores features for given key and mask size, evicting the least recently used entry when full
+    void insert(uint64_t key, cv::Size size, const ROIFeatures& features)
+    {
+        if (capacity == 0) return;
+
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            it->second->size = size;
+            it->second->features = features;
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+
+        if (entries.size() >= capacity)
+        {
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+
+        entries.push_front(Entry{key, size, features});
+        index[key] = entries.begin();
+    }
+
+    void clear()
+    {
+        entries.clear();
+        index.clear();
+        hits = 0;
+        misses = 0;
+    }
+
+    size_t size() const { return entries.size(); }
+    size_t getHits() const { return hits; }
+    size_t getMisses() const { return misses; }
+
+    double getHitRate() const
+    {
+        size_t lookups = hits + misses;
+        if (lookups == 0) return 0;
+        return static_cast<double>(hits) / lookups;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        cv::Size size;
+        ROIFeatures features;
+    };
+
+    size_t capacity;
+    size_t hits = 0;
+    size_t misses = 0;
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <vector>
+#include "pipeline.h"
+
+//! STREAMING PIPELINE
+// Pushes bands of rows through scale -> HSV -> threshold -> erosion -> dilation -> labeling.
+// Threshold and eroded rows live in ring buffers of band + 2 * radius rows, only the final mask is kept
+// at full size since analyseROIs needs it. Results are identical to runDetection.
+
+// Incremental 8-connected labeling of white pixels fed one row at a time
+// Components are merged through union-find, so the ones spanning several bands join as rows arrive
+class StreamingLabeler
+{
+public:
+    explicit StreamingLabeler(int width) : previous(width, 0), current(width, 0)
+    {
+        // Label 0 marks background
+        parent.push_back(0);
+        boxes.push_back(cv::Vec4i());
+        moments.push_back(ShapeMoments());
+    }
+
+    void addRow(const uchar* row, int y)
+    {
+        int width = static_cast<int>(current.size());
+
+        for (int x = 0; x < width; x++)
+        {
+            if (row[x] != 255)
+            {
+                current[x] = 0;
+                continue;
+            }
+
+            int label = 0;
+            if (x > 0) label = join(label, current[x - 1]);
+            if (y > 0)
+            {
+                if (x > 0) label = join(label, previous[x - 1]);
+                label = join(label, previous[x]);
+                if (x + 1 < width) label = join(label, previous[x + 1]);
+            }
+
+            if (label == 0)
+            {
+                label = static_cast<int>(parent.size());
+                parent.push_back(label);
+                boxes.push_back(cv::Vec4i(x, y, x, y));
+                moments.push_back(ShapeMoments());
+            }
+            else
+            {
+                cv::Vec4i& box = boxes[label];
+                box[0] = std::min(box[0], x);
+                box[1] = std::min(box[1], y);
+                box[2] = std::max(box[2], x);
+                box[3] = std::max(box[3], y);
+            }
+
+            moments[label].addPixel(y, x);
+            current[x] = label;
+        }
+
+        previous.swap(current);
+    }
+
+    // Returns boxes of components within size limits, ordered like findROIs by their first pixel
+    std::vector<cv::Vec4i> getROIs(int min_width, int min_height, int max_width, int max_height, std::vector<ShapeMoments>* roi_moments = nullptr) const
+    {
+        std::vector<cv::Vec4i> rois;
+
+        // Labels are created in raster order and a root is always the smallest label of its component
+        for (size_t label = 1; label < parent.size(); label++)
+        {
+            if (parent[label] != static_cast<int>(label)) continue;
+
+            const cv::Vec4i& box = boxes[label];
+            int width = box[2] - box[0];
+            int height = box[3] - box[1];
+            if (width >= min_width && height >= min_height && width <= max_width && height <= max_height)
+            {
+                rois.push_back(box);
+                if (roi_moments != nullptr) roi_moments->push_back(moments[label]);
+            }
+        }
+
+        return rois;
+    }
+
+private:
+    int find(int label)
+    {
+        while (parent[label] != label)
+        {
+            parent[label] = parent[parent[label]];
+            label = parent[label];
+        }
+        return label;
+    }
+
+    // Merges the component of given neighbor into the one of label, keeps the smaller label as root
+    int join(int label, int neighbor)
+    {
+        if (neighbor == 0) return label;
+        neighbor = find(neighbor);
+        if (label == 0 || label == neighbor) return neighbor;
+
+        int root = std::min(label, neighbor);
+        int child = std::max(label, neighbor);
+        parent[child] = root;
+
+        cv::Vec4i& box = boxes[root];
+        const cv::Vec4i& merged = boxes[child];
+        box[0] = std::min(box[0], merged[0]);
+        box[1] = std::min(box[1], merged[1]);
+        box[2] = std::max(box[2], merged[2]);
+        box[3] = std::max(box[3], merged[3]);
+        moments[root].merge(moments[child]);
+
+        return root;
+    }
+
+    std::vector<int> parent;
+    std::vector<cv::Vec4i> boxes;
+    std::vector<ShapeMoments> moments;
+    std::vector<int> previous;
+    std::vector<int> current;
+};
+
+// Fixed number of image rows addressed by their absolute row index
+class RowRing
+{
+public:
+    RowRing(int rows, int width) : rows(rows), width(width), data(static_cast<size_t>(rows) * width) {}
+
+    uchar* row(int y) { return data.data() + static_cast<size_t>(y % rows) * width; }
+
+private:
+    int rows;
+    int width;
+    std::vector<uchar> data;
+};
+
+// Runs all detection stages on a single BGR image, streaming bands of rows instead of full frames
+// Only the HSV front end is streamed, local means of the grayscale one need whole blocks of rows
+DetectionResult runStreamingDetection(const cv::Mat& img, const DetectionParams& params, ROIFeatureCache* cache = nullptr,
+                                      StageTimings* timings = nullptr, int band_rows = 16)
+{
+    CV_Assert(img.type() == CV_8UC3);
+    CV_Assert(params.front_end == FrontEnd::HSV);
+    CV_Assert(params.mask_size >= 3 && params.mask_size % 2 == 1);
+    CV_Assert(band_rows > 0);
+
+    DetectionResult result;
+    std::vector<ShapeMoments> moments;
+
+    // Same sampling as scaleImage
+    int out_width = static_cast<int>(img.cols * params.scale / 100.0);
+    int out_height = static_cast<int>(img.rows * params.scale / 100.0);
+    double x_scale = static_cast<double>(img.cols) / out_width;
+    double y_scale = static_cast<double>(img.rows) / out_height;
+    int radius = params.mask_size / 2;
+
+    result.mask = cv::Mat(out_height, out_width, CV_8U);
+    if (out_width == 0 || out_height == 0) return result;
+
+    {
+        StageTimer timer(timings != nullptr ? &timings->streamed : nullptr);
+
+        std::vector<int> source_x(out_width);
+        for (int x = 0; x < out_width; x++) source_x[x] = static_cast<int>(x * x_scale);
+
+        RowRing thresholded(band_rows + 2 * radius, out_width);
+        RowRing eroded(band_rows + 2 * radius, out_width);
+        StreamingLabeler labeler(out_width);
+
+        std::vector<const uchar*> rows(2 * radius + 1);
+        std::vector<const uchar*> source_rows;
+
+        // Scale, convert and threshold a single row
+        auto thresholdBandRow = [&](int y)
+        {
+            const cv::Vec3b* source = img.ptr<cv::Vec3b>(static_cast<int>(y * y_scale));
+            uchar* out = thresholded.row(y);
+
+            for (int x = 0; x < out_width; x++)
+            {
+                if (isInHSVRange(convertPixelToHSV(source[source_x[x]]), params.lower_margin, params.upper_margin)) out[x] = 255;
+                else out[x] = 0;
+            }
+        };
+
+        // Erosion of black pixels, rows within radius of the border are copied as in applyErosion
+        auto erodeBandRow = [&](int y)
+        {
+            const uchar* in = thresholded.row(y);
+            uchar* out = eroded.row(y);
+            std::copy(in, in + out_width, out);
+            if (y < radius || y >= out_height - radius) return;
+
+            for (int dy = -radius; dy <= radius; dy++) rows[dy + radius] = thresholded.row(y + dy);
+            erodeRow(rows, out, out_width, radius, 0);
+        };
+
+        // Dilation of black pixels gathered from the interior rows within radius, as in applyDilation
+        auto dilateBandRow = [&](int y)
+        {
+            const uchar* in = eroded.row(y);
+            uchar* out = result.mask.ptr<uchar>(y);
+            std::copy(in, in + out_width, out);
+
+            source_rows.clear();
+            for (int source_y = std::max(y - radius, radius); source_y <= std::min(y + radius, out_height - radius - 1); source_y++)
+            {
+                source_rows.push_back(eroded.row(source_y));
+            }
+            dilateRow(source_rows, out, out_width, radius, 0);
+        };
+
+        int thresholded_rows = 0;
+        int eroded_rows = 0;
+        int dilated_rows = 0;
+
+        while (dilated_rows < out_height)
+        {
+            // Each stage runs ahead of the next one by the morphology radius
+            int band_end = std::min(dilated_rows + band_rows, out_height);
+            int eroded_end = std::min(band_end + radius, out_height);
+            int thresholded_end = std::min(eroded_end + radius, out_height);
+
+            for (; thresholded_rows < thresholded_end; thresholded_rows++) thresholdBandRow(thresholded_rows);
+            for (; eroded_rows < eroded_end; eroded_rows++) erodeBandRow(eroded_rows);
+            for (; dilated_rows < band_end; dilated_rows++)
+            {
+                dilateBandRow(dilated_rows);
+                labeler.addRow(result.mask.ptr<uchar>(dilated_rows), dilated_rows);
+            }
+        }
+
+        result.rois = labeler.getROIs(params.min_width, params.min_height, out_width / 2, out_height / 2, &moments);
+    }
+
+    // Test all ROIs and retain only those that meet the criteria
+    std::vector<int> confirmed_indices;
+    {
+        StageTimer timer(timings != nullptr ? &timings->analyse_rois : nullptr);
+        result.confirmed_rois = analyseROIs(result.mask, result.rois, cache, &confirmed_indices);
+    }
+
+    finishDetection(result, moments, confirmed_indices, params.scale, img.size());
+
+    return result;
+}
@@ -1,10 +1,15 @@
+#pragma once
+
 #include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <stack>
 #include "m_values.h"
+#include "roi_cache.h"
 
 namespace fs = std::filesystem;
 
@@ -34,8 +39,8 @@ void adjustScaledValues(std::vector<cv::Vec4i>& rois, double scale) {
 
 //! CORE METHODS
 
-// Initiate flood fill algorithm to find boundaries of white pixel regions
-void floodFillImage(const cv::Mat& image, cv::Mat& flood_image, int label, int x, int y, int& min_x, int& min_y, int& max_x, int& max_y)
+// Initiate flood fill algorithm to find boundaries of white pixel regions, optionally gathering their moments
+void floodFillImage(const cv::Mat& image, cv::Mat& flood_image, int label, int x, int y, int& min_x, int& min_y, int& max_x, int& max_y, ShapeMoments* moments = nullptr)
 {
     std::stack<std::pair<int, int>> stack;
     stack.push(std::make_pair(x, y));
@@ -47,7 +52,10 @@ void floodFillImage(const cv::Mat& image, cv::Mat& flood_image, int label, int x
         int px = p.first;
         int py = p.second;
 
+        // A pixel may be pushed by several neighbors before it's visited
+        if (flood_image.at<int>(py, px) == label) continue;
         flood_image.at<int>(py, px) = label;
+        if (moments != nullptr) moments->addPixel(py, px);
 
         min_x = std::min(min_x, px);
         min_y = std::min(min_y, py);
@@ -108,7 +116,8 @@ void floodFillImage(cv::Mat& image, int x, int y, uchar in_pixel_val, uchar out_
 }
 
 // Initiate ROI search utilising flood fill algorithm to extract ROI box top left and bottom right coordinates
-std::vector<cv::Vec4i> findROIs(const cv::Mat& image, int min_width, int min_height, int max_width, int max_height)
+// Moments of each returned ROI's component are gathered in the same pass when requested
+std::vector<cv::Vec4i> findROIs(const cv::Mat& image, int min_width, int min_height, int max_width, int max_height, std::vector<ShapeMoments>* moments = nullptr)
 {
     std::vector<cv::Vec4i> rois;
 
@@ -125,12 +134,13 @@ std::vector<cv::Vec4i> findROIs(const cv::Mat& image, int min_width, int min_hei
                 int minY = y;
                 int maxX = x;
                 int maxY = y;
-                floodFillImage(image, flood_image, label, x, y, minX, minY, maxX, maxY);
+                ShapeMoments component_moments;
+                floodFillImage(image, flood_image, label, x, y, minX, minY, maxX, maxY, moments != nullptr ? &component_moments : nullptr);
                 
                 if ((maxX - minX >= min_width) && (maxY - minY >= min_height) && (maxX - minX <= max_width) && (maxY - minY <= max_height))
                 {
                     rois.push_back(cv::Vec4i(minX, minY, maxX, maxY));
-
+                    if (moments != nullptr) moments->push_back(component_moments);
                 }
 
                 label++;
@@ -182,6 +192,47 @@ cv::Mat removeClusters(const cv::Mat& image, uchar in_pixel_val, uchar out_pixel
     return out_image;
 }
 
+// Dilates a single row, out must hold a copy of the row and source_rows the interior rows within radius of it
+void dilateRow(const std::vector<const uchar*>& source_rows, uchar* out, int width, int radius, uchar pixel_value)
+{
+    for (const uchar* source : source_rows)
+    {
+        for (int x = radius; x < width - radius; x++)
+        {
+            if (source[x] == pixel_value) std::fill(out + x - radius, out + x + radius + 1, pixel_value);
+        }
+    }
+}
+
+// Erodes a single interior row, out must hold a copy of the row and rows the 2 * radius + 1 rows centered on it
+void erodeRow(const std::vector<const uchar*>& rows, uchar* out, int width, int radius, uchar pixel_value)
+{
+    uchar opposite_pixel;
+    if (pixel_value == 0) opposite_pixel = 255;
+    else opposite_pixel = 0;
+
+    const uchar* center = rows[radius];
+    for (int x = radius; x < width - radius; x++)
+    {
+        if (center[x] == pixel_value)
+        {
+            bool erode = false;
+            for (int dy = 0; dy <= 2 * radius && !erode; dy++)
+            {
+                for (int dx = -radius; dx <= radius; dx++)
+                {
+                    if (rows[dy][x + dx] == opposite_pixel)
+                    {
+                        erode = true;
+                        break;
+                    }
+                }
+            }
+            if (erode) out[x] = opposite_pixel;
+        }
+    }
+}
+
 // Initiaties dilation algorithm on given pixel values
 cv::Mat applyDilation(const cv::Mat& image, int mask_size, uchar pixel_value)
 {
@@ -191,22 +242,17 @@ cv::Mat applyDilation(const cv::Mat& image, int mask_size, uchar pixel_value)
     int height = image.rows;
     int width = image.cols;
     int radius = mask_size / 2;
+    std::vector<const uchar*> source_rows;
 
-    for (int y = radius; y < height - radius; y++)
+    // Each row gathers the spread of interior pixels within radius of it
+    for (int y = 0; y < height; y++)
     {
-        for (int x = radius; x < width - radius; x++)
+        source_rows.clear();
+        for (int source_y = std::max(y - radius, radius); source_y <= std::min(y + radius, height - radius - 1); source_y++)
         {
-            if (image.at<uchar>(y, x) == pixel_value)
-            {
-                for (int dy = -radius; dy <= radius; dy++)
-                {
-                    for (int dx = -radius; dx <= radius; dx++)
-                    {
-                        out_image.at<uchar>(y + dy, x + dx) = image.at<uchar>(y, x);
-                    }
-                }
-            }
+            source_rows.push_back(image.ptr<uchar>(source_y));
         }
+        dilateRow(source_rows, out_image.ptr<uchar>(y), width, radius, pixel_value);
     }
 
     return out_image;
@@ -218,41 +264,28 @@ cv::Mat applyErosion(const cv::Mat& image, int maskSize, uchar pixel_value)
     CV_Assert(maskSize >= 3 && maskSize % 2 == 1);
     cv::Mat dst = image.clone();
 
-    uchar opposite_pixel;
-    if (pixel_value == 0) opposite_pixel = 255;
-    else opposite_pixel = 0;
-
     int height = image.rows;
     int width = image.cols;
     int radius = maskSize / 2;
+    std::vector<const uchar*> rows(2 * radius + 1);
 
     for (int y = radius; y < height - radius; y++)
     {
-        for (int x = radius; x < width - radius; x++)
-        {
-            if (image.at<uchar>(y, x) == pixel_value)
-            {
-                bool erode = false;
-                for (int dy = -radius; dy <= radius; dy++)
-                {
-                    for (int dx = -radius; dx <= radius; dx++)
-                    {
-                        if (image.at<uchar>(y + dy, x + dx) == opposite_pixel)
-                        {
-                            erode = true;
-                            break;
-                        }
-                    }
-                    if (erode) break;
-                }
-                if (erode) dst.at<uchar>(y, x) = opposite_pixel;
-            }
-        }
+        for (int dy = -radius; dy <= radius; dy++) rows[dy + radius] = image.ptr<uchar>(y + dy);
+        erodeRow(rows, dst.ptr<uchar>(y), width, radius, pixel_value);
     }
 
     return dst;
 }
 
+// Tells whether HSV pixel lies within lower and upper margins
+bool isInHSVRange(const cv::Vec3b& pixel, const std::vector<uchar>& lower_margin, const std::vector<uchar>& upper_margin)
+{
+    return pixel[0] >= lower_margin.at(0) && pixel[0] <= upper_margin.at(0) &&
+           pixel[1] >= lower_margin[1] && pixel[1] <= upper_margin[1] &&
+           pixel[2] >= lower_margin[2] && pixel[2] <= upper_margin[2];
+}
+
 // Initiaties thresholding algorithm based on lower and upper HSV values margins
 cv::Mat applyHSVThresholding(const cv::Mat& image, std::vector<uchar> lower_margin, std::vector<uchar> upper_margin)
 {
@@ -265,16 +298,7 @@ cv::Mat applyHSVThresholding(const cv::Mat& image, std::vector<uchar> lower_marg
     {
         for (int x = 0; x < image.cols; ++x)
         {
-            uchar hue = image.at<cv::Vec3b>(y, x)[0];
-            uchar saturation = image.at<cv::Vec3b>(y, x)[1];
-            uchar value = image.at<cv::Vec3b>(y, x)[2];
-
-            if (hue >= lower_margin.at(0) && hue <= upper_margin.at(0) &&
-                saturation >= lower_margin[1] && saturation <= upper_margin[1] &&
-                value >= lower_margin[2] && value <= upper_margin[2])
-            {
-                out_img.at<uchar>(y, x) = 255;
-            }
+            if (isInHSVRange(image.at<cv::Vec3b>(y, x), lower_margin, upper_margin)) out_img.at<uchar>(y, x) = 255;
             else out_img.at<uchar>(y, x) = 0;
         }
     }
@@ -282,6 +306,32 @@ cv::Mat applyHSVThresholding(const cv::Mat& image, std::vector<uchar> lower_marg
     return out_img;
 }
 
+// Converts a single BGR pixel to HSV palette
+cv::Vec3b convertPixelToHSV(const cv::Vec3b& pixel)
+{
+    double red = pixel[2] / 255.0;
+    double green = pixel[1] / 255.0;
+    double blue = pixel[0] / 255.0;
+
+    double Cmax = std::max({red, green, blue});
+    double Cmin = std::min({red, green, blue});
+    double delta = Cmax - Cmin;
+
+    double value = Cmax;
+    double hue = 0;
+    double saturation;
+
+    if (Cmax == red) hue = 60.0 * fmod((green - blue) / delta, 6);
+    else if (Cmax == green) hue = 60.0 * (((blue - red) / delta) + 2);
+    else if (Cmax == blue) hue = 60.0 * (((blue - red) / delta) + 4);
+    if (hue < 0) hue += 360;
+
+    if (Cmax == 0) saturation = 0.0;
+    else saturation = delta / Cmax;
+
+    return cv::Vec3b(static_cast<uchar>(hue / 2), static_cast<uchar>(saturation * 255), static_cast<uchar>(value * 255));
+}
+
 // Converts given BGR image to HSV palette
 cv::Mat convertToHSV(const cv::Mat& image)
 {
@@ -291,29 +341,7 @@ cv::Mat convertToHSV(const cv::Mat& image)
     {
         for (int x = 0; x < image.cols; x++)
         {
-            double red = image.at<cv::Vec3b>(y, x)[2] / 255.0;
-            double green = image.at<cv::Vec3b>(y, x)[1] / 255.0;
-            double blue = image.at<cv::Vec3b>(y, x)[0] / 255.0;
-
-            double Cmax = std::max({red, green, blue});
-            double Cmin = std::min({red, green, blue});
-            double delta = Cmax - Cmin;
-
-            double value = Cmax;
-            double hue = 0;
-            double saturation;
-
-            if (Cmax == red) hue = 60.0 * fmod((green - blue) / delta, 6);
-            else if (Cmax == green) hue = 60.0 * (((blue - red) / delta) + 2);
-            else if (Cmax == blue) hue = 60.0 * (((blue - red) / delta) + 4);
-            if (hue < 0) hue += 360;
-
-            if (Cmax == 0) saturation = 0.0;
-            else saturation = delta / Cmax;
-
-            out_img.at<cv::Vec3b>(y, x)[0] = static_cast<uchar>(hue / 2);
-            out_img.at<cv::Vec3b>(y, x)[1] = static_cast<uchar>(saturation * 255);
-            out_img.at<cv::Vec3b>(y, x)[2] = static_cast<uchar>(value * 255);
+            out_img.at<cv::Vec3b>(y, x) = convertPixelToHSV(image.at<cv::Vec3b>(y, x));
         }
     }
 
@@ -321,7 +349,7 @@ cv::Mat convertToHSV(const cv::Mat& image)
 }
 
 // Scales the image down to given scaling factor (0.0+ - 1.0)
-cv::Mat scaleImage(cv::Mat& image, double scale)
+cv::Mat scaleImage(const cv::Mat& image, double scale)
 {
     int width = image.cols;
     int height = image.rows;
@@ -348,19 +376,54 @@ cv::Mat scaleImage(cv::Mat& image, double scale)
 }
 
 // Converts BGR image to grayscale
-cv::Mat convertToGrayscale(cv::Mat image)
+// Rec. 709 luma weights in 8 bit fixed point, so the weighted sum fits 16 bit lanes, within 1 of the exact value
+cv::Mat convertToGrayscale(const cv::Mat& image)
 {
-    CV_Assert(image.depth() != sizeof(uchar));
-    cv::Mat_<cv::Vec3b> _I = image;
-    cv::Mat grayscale_img(image.rows, image.cols, CV_8UC1, cv::Scalar(0));
-
-    for (int y = 0; y < _I.rows; ++y) {
-        for (int x = 0; x < _I.cols; ++x) {
-            double intensity =
-                (0.0722 * _I(y, x)[0]
-                    + 0.7152 * _I(y, x)[1]
-                    + 0.2126 * _I(y, x)[2]);
-            grayscale_img.at<uchar>(y, x) = static_cast<uchar>(intensity);
+    CV_Assert(image.type() == CV_8UC3);
+    cv::Mat grayscale_img(image.rows, image.cols, CV_8UC1);
+
+    const ushort blue_weight = 19;   // 0.0722
+    const ushort green_weight = 183; // 0.7152
+    const ushort red_weight = 54;    // 0.2126
+
+    const int width = image.cols;
+    for (int y = 0; y < image.rows; ++y)
+    {
+        const uchar* in = image.ptr<uchar>(y);
+        uchar* out = grayscale_img.ptr<uchar>(y);
+        int x = 0;
+
+#if CV_SIMD
+        // Deinterleave a vector of pixels per channel, widen to 16 bits and multiply-add the weights
+        const cv::v_uint16 blue_weights = cv::vx_setall_u16(blue_weight);
+        const cv::v_uint16 green_weights = cv::vx_setall_u16(green_weight);
+        const cv::v_uint16 red_weights = cv::vx_setall_u16(red_weight);
+        const int lanes = CV_SIMD_WIDTH;
+
+        for (; x <= width - lanes; x += lanes)
+        {
+            cv::v_uint8 blue, green, red;
+            cv::v_load_deinterleave(in + 3 * x, blue, green, red);
+
+            cv::v_uint16 blue_low, blue_high, green_low, green_high, red_low, red_high;
+            cv::v_expand(blue, blue_low, blue_high);
+            cv::v_expand(green, green_low, green_high);
+            cv::v_expand(red, red_low, red_high);
+
+            cv::v_uint16 low = cv::v_add_wrap(cv::v_add_wrap(cv::v_mul_wrap(blue_low, blue_weights), cv::v_mul_wrap(green_low, green_weights)),
+                                              cv::v_mul_wrap(red_low, red_weights));
+            cv::v_uint16 high = cv::v_add_wrap(cv::v_add_wrap(cv::v_mul_wrap(blue_high, blue_weights), cv::v_mul_wrap(green_high, green_weights)),
+                                               cv::v_mul_wrap(red_high, red_weights));
+
+            cv::v_store(out + x, cv::v_pack(cv::v_shr<8>(low), cv::v_shr<8>(high)));
+        }
+#endif
+
+        // Remaining pixels, same arithmetic as the vector path
+        for (; x < width; ++x)
+        {
+            ushort intensity = static_cast<ushort>(blue_weight * in[3 * x] + green_weight * in[3 * x + 1] + red_weight * in[3 * x + 2]);
+            out[x] = static_cast<uchar>(intensity >> 8);
         }
     }
 
@@ -384,50 +447,126 @@ cv::Mat applyGrayscaleThresholding(cv::Mat& image, int threshold)
     return out_img;
 }
 
+// Initiaties adaptive thresholding, pixels brighter than the mean of their block by more than offset become white
+// Block sums come from an integral image, so the cost doesn't depend on block size
+cv::Mat applyAdaptiveThresholding(const cv::Mat& image, int block_size, int offset)
+{
+    CV_Assert(image.type() == CV_8UC1);
+    CV_Assert(block_size >= 3 && block_size % 2 == 1);
+
+    int height = image.rows;
+    int width = image.cols;
+    int radius = block_size / 2;
+    size_t integral_width = width + 1;
+
+    // The integral image wraps around on large images, the box sums below are taken modulo 2^32 as well,
+    // so they stay exact as long as a single block sum fits 32 bits
+    CV_Assert(static_cast<uint64_t>(std::min(block_size, height)) * std::min(block_size, width) <= UINT32_MAX / 255);
+    std::vector<uint32_t> integral(integral_width * (height + 1), 0);
+    for (int y = 0; y < height; y++)
+    {
+        const uchar* in = image.ptr<uchar>(y);
+        const uint32_t* above = integral.data() + y * integral_width;
+        uint32_t* current = integral.data() + (y + 1) * integral_width;
+        uint32_t row_sum = 0;
+
+        for (int x = 0; x < width; x++)
+        {
+            row_sum += in[x];
+            current[x + 1] = above[x + 1] + row_sum;
+        }
+    }
+
+    cv::Mat out_img(height, width, CV_8U);
+    for (int y = 0; y < height; y++)
+    {
+        int y1 = std::max(y - radius, 0);
+        int y2 = std::min(y + radius + 1, height);
+        const uint32_t* top = integral.data() + y1 * integral_width;
+        const uint32_t* bottom = integral.data() + y2 * integral_width;
+        const uchar* in = image.ptr<uchar>(y);
+        uchar* out = out_img.ptr<uchar>(y);
+
+        for (int x = 0; x < width; x++)
+        {
+            int x1 = std::max(x - radius, 0);
+            int x2 = std::min(x + radius + 1, width);
+            int64_t count = static_cast<int64_t>(x2 - x1) * (y2 - y1);
+            int64_t sum = static_cast<uint32_t>(bottom[x2] - bottom[x1] - top[x2] + top[x1]);
+
+            // pixel > sum / count + offset without division
+            if ((static_cast<int64_t>(in[x]) - offset) * count > sum) out[x] = 255;
+            else out[x] = 0;
+        }
+    }
+
+    return out_img;
+}
+
 //! M's AND OTHER ANALYSIS
 
+// Computes shape features of a single ROI region and tests them against the criteria
+ROIFeatures computeROIFeatures(const cv::Mat& roi_image_region)
+{
+    ROIFeatures features;
+    cv::Mat corrected_roi_region = removeClusters(roi_image_region, 0, 255);
+
+    features.M6 = getM6(corrected_roi_region);
+    double M6_dev = 0.001;
+    double M6_average = 0.000384396;
+
+    features.M7 = getM7(corrected_roi_region);
+    double M7_dev = 0.003;
+    double M7_average = 0.022796325;
+
+    double area_white = getArea(corrected_roi_region, 255);
+    double area_black = getArea(corrected_roi_region, 0);
+    if (area_black != 0) features.area_diff = area_white / area_black;
+    else features.area_diff = 0;
+
+    cv::Vec2d area_diff_average = cv::Vec2d(3, 5);
+    cv::Vec2d M6_range = cv::Vec2d(M6_average - M6_dev, M6_average + M6_dev);
+    cv::Vec2d M7_range = cv::Vec2d(M7_average - M7_dev, M7_average + M7_dev);
+
+    features.accepted = (features.M6 > M6_range[0]) && (features.M6 < M6_range[1]) &&
+                        (features.M7 > M7_range[0]) && (features.M7 < M7_range[1]) &&
+                        (features.area_diff > area_diff_average[0]) && (features.area_diff < area_diff_average[1]);
+
+    return features;
+}
+
 // Checks a vector containing ROI coordinates and returns only those that pass tests
-std::vector<cv::Vec4i> analyseROIs(cv::Mat& image, std::vector<cv::Vec4i> rois)
+// Optional cache allows skipping the analysis of components identical to ones seen before
+// Indices of confirmed ROIs within the input vector are stored when requested
+std::vector<cv::Vec4i> analyseROIs(const cv::Mat& image, std::vector<cv::Vec4i> rois, ROIFeatureCache* cache = nullptr, std::vector<int>* confirmed_indices = nullptr)
 {
     std::vector<cv::Vec4i> confirmed_rois;
-    for(auto& roi : rois)
+    for(size_t i = 0; i < rois.size(); i++)
     {
+        const cv::Vec4i& roi = rois[i];
         int x1 = roi[0];
         int y1 = roi[1];
         int x2 = roi[2];
         int y2 = roi[3];
 
         auto roi_image_region = image(cv::Rect(x1, y1, x2 - x1, y2 - y1));
-        cv::Mat corrected_roi_region = removeClusters(roi_image_region, 0, 255);
-
-        double M6 = getM6(corrected_roi_region);
-        double M6_dev = 0.001;
-        double M6_average = 0.000384396;
-
-        double M7 = getM7(corrected_roi_region);
-        double M7_dev = 0.003;
-        double M7_average = 0.022796325;
 
-        double area_white = getArea(corrected_roi_region, 255);
-        double area_black = getArea(corrected_roi_region, 0);
-        double area_diff;
-        if (area_black != 0) area_diff = area_white / area_black;
-        else area_diff = 0;
-
-        cv::Vec2d area_diff_average = cv::Vec2d(3, 5);
-        cv::Vec2d M6_range = cv::Vec2d(M6_average - M6_dev, M6_average + M6_dev);
-        cv::Vec2d M7_range = cv::Vec2d(M7_average - M7_dev, M7_average + M7_dev);
-
-        if((M6 > M6_range[0]) && (M6 < M6_range[1]))
+        ROIFeatures features;
+        if (cache == nullptr) features = computeROIFeatures(roi_image_region);
+        else
         {
-            if ((M7 > M7_range[0]) && (M7 < M7_range[1]))
+            uint64_t key = hashROIMask(roi_image_region);
+            if (!cache->find(key, roi_image_region.size(), features))
             {
-                if ((area_diff > area_diff_average[0]) && (area_diff < area_diff_average[1]))
-                {
-                    confirmed_rois.push_back(roi);
-                }
+                features = computeROIFeatures(roi_image_region);
+                cache->insert(key, roi_image_region.size(), features);
             }
         }
+
+        if (!features.accepted) continue;
+
+        confirmed_rois.push_back(roi);
+        if (confirmed_indices != nullptr) confirmed_indices->push_back(static_cast<int>(i));
     }
 
     return confirmed_rois;
@@ -463,21 +602,11 @@ cv::Mat showROIs(const cv::Mat& image, std::vector<cv::Vec4i> rois)
     return out_image;
 }
 
-// Saves an image with confirmed ROIs marked
-void saveDetectionResults(const cv::Mat& image, std::vector<cv::Vec4i> rois, std::string name)
+// Marks confirmed ROIs on the image in place
+void markDetections(cv::Mat& image, const std::vector<cv::Vec4i>& rois)
 {
-    cv::Mat out_image = image.clone();
-
     for(auto& roi : rois)
     {
-        int x1 = roi[0];
-        int y1 = roi[1];
-        int x2 = roi[2];
-        int y2 = roi[3];
-
-        drawRectangle(out_image, x1, y1, x2, y2, cv::Vec3b(0, 255, 0));
-        std::cout<<x1<<" "<<y1<<" "<<x2<<" "<<y2<<" "<<"\n";
+        drawRectangle(image, roi[0], roi[1], roi[2], roi[3], cv::Vec3b(0, 255, 0));
     }
-
-    cv::imwrite("../detection_" + name + ".jpeg", out_image);
-}
\ No newline at end of file
+}